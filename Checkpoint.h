@@ -0,0 +1,242 @@
+#pragma once
+
+#include "Common.h"
+
+#include <gtest/gtest.h>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* A checkpoint file contains everything needed to continue a test from a certain point:
+ * the contents of RAM, the swap file and the position of the trace.
+ *
+ * Note that the trace is shared by the entire process(creating a 'Trace' doesn't clear it),
+ * so its contents are only saved on request - they include every operation of every previous test.
+ *
+ * Layout(all in native byte order):
+ *
+ *   CheckpointHeader
+ *   NUM_FRAMES * PAGE_SIZE words                      - RAM, frame by frame
+ *   swapPageCount * (uint64_t page index, PAGE_SIZE words) - swap file
+ *   traceLength chars                                 - trace contents, if saved(otherwise 0)
+ *
+ * A checkpoint can be loaded by any test executable whose memory constants have the same geometry
+ * as the one that saved it.
+ */
+
+const char CHECKPOINT_MAGIC[8] = {'E', 'X', '4', 'C', 'K', 'P', 'T', '\0'};
+
+/** Increment this whenever the layout above changes */
+const uint32_t CHECKPOINT_VERSION = 2;
+
+/** Written as-is, used to detect a checkpoint that was saved with a different byte order */
+const uint32_t CHECKPOINT_BYTE_ORDER_MARK = 0x01020304;
+
+struct CheckpointHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrderMark;
+    uint32_t wordSize;
+    uint32_t offsetWidth;
+    uint32_t physicalAddressWidth;
+    uint32_t virtualAddressWidth;
+    uint64_t swapPageCount;
+    uint64_t tracePosition;
+    uint64_t traceLength;
+};
+
+/** Returns the size in bytes of a checkpoint file of the current geometry */
+uint64_t checkpointFileSize(uint64_t swapPageCount, uint64_t traceLength)
+{
+    return sizeof(CheckpointHeader)
+           + NUM_FRAMES * PAGE_SIZE * sizeof(word_t)
+           + swapPageCount * (sizeof(uint64_t) + PAGE_SIZE * sizeof(word_t))
+           + traceLength;
+}
+
+/** Returns the number of characters written to the trace so far */
+uint64_t currentTracePosition()
+{
+    std::streampos pos = Trace::stream().tellp();
+    return pos < 0 ? 0 : static_cast<uint64_t>(pos);
+}
+
+/**
+ * Saves RAM, the swap file and the trace position into a checkpoint file
+ * @param path File to create(or overwrite)
+ * @param includeTrace Also save the entire trace contents, see note above
+ * @return Whether the checkpoint was saved, with the reason on failure
+ */
+::testing::AssertionResult saveCheckpoint(const std::string& path, bool includeTrace = false)
+{
+    if (RAM.size() != NUM_FRAMES)
+    {
+        return ::testing::AssertionFailure() << "RAM isn't initialized, nothing to save";
+    }
+
+    std::string trace = includeTrace ? Trace::stream().str() : std::string();
+
+    CheckpointHeader header;
+    std::memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic));
+    header.version = CHECKPOINT_VERSION;
+    header.byteOrderMark = CHECKPOINT_BYTE_ORDER_MARK;
+    header.wordSize = sizeof(word_t);
+    header.offsetWidth = OFFSET_WIDTH;
+    header.physicalAddressWidth = PHYSICAL_ADDRESS_WIDTH;
+    header.virtualAddressWidth = VIRTUAL_ADDRESS_WIDTH;
+    header.swapPageCount = swapFile.size();
+    header.tracePosition = currentTracePosition();
+    header.traceLength = trace.size();
+
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!out)
+    {
+        return ::testing::AssertionFailure() << "Couldn't open \"" << path << "\" for writing";
+    }
+
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    for (const page_t& page: RAM)
+    {
+        out.write(reinterpret_cast<const char*>(page.data()), PAGE_SIZE * sizeof(word_t));
+    }
+    for (const auto& kvp: swapFile)
+    {
+        out.write(reinterpret_cast<const char*>(&kvp.first), sizeof(kvp.first));
+        out.write(reinterpret_cast<const char*>(kvp.second.data()), PAGE_SIZE * sizeof(word_t));
+    }
+    out.write(trace.data(), static_cast<std::streamsize>(trace.size()));
+
+    out.close();
+    if (!out)
+    {
+        return ::testing::AssertionFailure() << "Failed writing checkpoint to \"" << path << "\"";
+    }
+    return ::testing::AssertionSuccess();
+}
+
+/**
+ * Replaces RAM and the swap file(and the trace contents, if they were saved) with those saved in a
+ * checkpoint file. This can be used instead of 'fullyInitialize' to start a test from a saved state.
+ *
+ * The file is mapped to memory rather than read into a buffer, so each word is only copied once -
+ * straight into its frame.
+ *
+ * @param path Checkpoint file, created by 'saveCheckpoint'
+ * @param tracePosition If not null, receives the trace position at the time the checkpoint was saved
+ * @return Whether the checkpoint was loaded, with the reason on failure. On failure, the current
+ *         state is left unchanged.
+ */
+::testing::AssertionResult loadCheckpoint(const std::string& path, uint64_t* tracePosition = nullptr)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        return ::testing::AssertionFailure() << "Couldn't open \"" << path << "\": " << std::strerror(errno);
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || static_cast<uint64_t>(st.st_size) < sizeof(CheckpointHeader))
+    {
+        close(fd);
+        return ::testing::AssertionFailure() << "\"" << path << "\" is too small to be a checkpoint";
+    }
+    uint64_t fileSize = static_cast<uint64_t>(st.st_size);
+    void* mapped = mmap(nullptr, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED)
+    {
+        return ::testing::AssertionFailure() << "Couldn't map \"" << path << "\": " << std::strerror(errno);
+    }
+
+    const char* bytes = static_cast<const char*>(mapped);
+    CheckpointHeader header;
+    std::memcpy(&header, bytes, sizeof(header));
+
+    ::testing::AssertionResult result = ::testing::AssertionSuccess();
+    if (std::memcmp(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic)) != 0)
+    {
+        result = ::testing::AssertionFailure() << "\"" << path << "\" isn't a checkpoint file";
+    } else if (header.version != CHECKPOINT_VERSION)
+    {
+        result = ::testing::AssertionFailure() << "Checkpoint version is " << header.version
+                                               << ", expected " << CHECKPOINT_VERSION;
+    } else if (header.byteOrderMark != CHECKPOINT_BYTE_ORDER_MARK || header.wordSize != sizeof(word_t))
+    {
+        result = ::testing::AssertionFailure() << "Checkpoint was saved on a machine with a different word layout";
+    } else if (header.offsetWidth != OFFSET_WIDTH
+               || header.physicalAddressWidth != PHYSICAL_ADDRESS_WIDTH
+               || header.virtualAddressWidth != VIRTUAL_ADDRESS_WIDTH)
+    {
+        result = ::testing::AssertionFailure()
+            << "Checkpoint geometry (offset " << header.offsetWidth
+            << ", physical " << header.physicalAddressWidth
+            << ", virtual " << header.virtualAddressWidth
+            << ") is different than the current memory constants";
+    } else if (header.swapPageCount > NUM_PAGES
+               || checkpointFileSize(header.swapPageCount, 0) > fileSize
+               || checkpointFileSize(header.swapPageCount, header.traceLength) != fileSize
+               || (header.traceLength != 0 && header.traceLength != header.tracePosition))
+    {
+        result = ::testing::AssertionFailure() << "\"" << path << "\" is truncated or corrupt";
+    }
+
+    if (!result)
+    {
+        munmap(mapped, fileSize);
+        return result;
+    }
+
+    const char* cur = bytes + sizeof(header);
+    std::vector<page_t> loadedRAM;
+    loadedRAM.reserve(NUM_FRAMES);
+    for (uint64_t frame = 0; frame < NUM_FRAMES; ++frame)
+    {
+        const word_t* words = reinterpret_cast<const word_t*>(cur);
+        loadedRAM.emplace_back(words, words + PAGE_SIZE);
+        cur += PAGE_SIZE * sizeof(word_t);
+    }
+
+    std::unordered_map<uint64_t, page_t> loadedSwapFile;
+    loadedSwapFile.reserve(header.swapPageCount);
+    for (uint64_t i = 0; i < header.swapPageCount; ++i)
+    {
+        uint64_t pageIndex;
+        std::memcpy(&pageIndex, cur, sizeof(pageIndex));
+        cur += sizeof(pageIndex);
+        const word_t* words = reinterpret_cast<const word_t*>(cur);
+        if (pageIndex >= NUM_PAGES || !loadedSwapFile.emplace(pageIndex, page_t(words, words + PAGE_SIZE)).second)
+        {
+            munmap(mapped, fileSize);
+            return ::testing::AssertionFailure() << "\"" << path << "\" is truncated or corrupt: swap file page "
+                                                 << pageIndex << " is invalid or appears twice";
+        }
+        cur += PAGE_SIZE * sizeof(word_t);
+    }
+
+    std::string trace(cur, header.traceLength);
+    munmap(mapped, fileSize);
+
+    RAM.swap(loadedRAM);
+    swapFile.swap(loadedSwapFile);
+    AccessHeatmap::forgetFramePages();
+    if (header.traceLength != 0)
+    {
+        // replace the contents while keeping the stream positioned at its end, so that
+        // later operations are appended after the restored trace
+        Trace::stream().str("");
+        Trace::stream().clear();
+        Trace::stream() << trace;
+    }
+    if (tracePosition != nullptr)
+    {
+        *tracePosition = header.tracePosition;
+    }
+    return ::testing::AssertionSuccess();
+}
@@ -12,6 +12,7 @@
 #include <gtest/gtest.h>
 #include <cstdio>
 #include <cassert>
+#include <fstream>
 #include <map>
 #include <random>
 #include <regex>
@@ -72,6 +73,17 @@ PhysicalAddressToValueMap readGottenPhysicalAddressToValueMap(const PhysicalAddr
     return ::testing::AssertionSuccess();
 }
 
+/** Writes the access heatmap counted so far(see AccessHeatmap in PhysicalMemory.h) into
+ *  'baseName'.csv and 'baseName'.json
+ */
+void exportAccessHeatmap(const std::string& baseName)
+{
+    std::ofstream csv(baseName + ".csv");
+    AccessHeatmap::exportCSV(csv);
+    std::ofstream json(baseName + ".json");
+    AccessHeatmap::exportJSON(json);
+}
+
 // by default, use the same seed so that test results will be consistent with several runs.
 const bool USE_DETERMINED_SEED = true;
 
@@ -98,8 +110,6 @@ std::default_random_engine getRandomEngine(bool useDeterminedSeed = USE_DETERMIN
        return eng;
    }
 }
-typedef std::vector<word_t> page_t;
-
 extern std::vector<page_t> RAM;
 extern std::unordered_map<uint64_t, page_t> swapFile;
 
@@ -131,6 +141,7 @@ void fullyInitialize(InitializationMethod option) {
     RAM.clear();
 
     RAM.resize(NUM_FRAMES, page_t(PAGE_SIZE));
+    AccessHeatmap::forgetFramePages();
 
     auto randomEngine = getRandomEngine();
     std::uniform_int_distribution<word_t> dist(0, std::numeric_limits<word_t>::max());
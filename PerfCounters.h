@@ -0,0 +1,237 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <string>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+/** Hardware/software events that can be counted around a region of a test */
+enum class PerfEvent
+{
+    Cycles = 0,
+    Instructions,
+    L1DataMisses,
+    LLCMisses,
+    BranchMisses,
+    PageFaults,
+
+    /** Not an event, the number of events above */
+    Count
+};
+
+/** Wraps perf_event_open, counting PerfEvent's (user space only) between start() and stop()
+ *
+ *  Every counter is opened on its own, so if some of them aren't supported(e.g, inside a VM,
+ *  or when perf_event_paranoid forbids it) the rest are still counted. When nothing can be
+ *  counted(or when not on Linux), all operations silently do nothing and report() says so,
+ *  so it is always safe to wrap a test with this.
+ */
+class PerfCounters
+{
+    static const int EVENT_COUNT = static_cast<int>(PerfEvent::Count);
+
+    int fds[EVENT_COUNT];
+    uint64_t values[EVENT_COUNT];
+
+public:
+
+    PerfCounters()
+    {
+        for (int i = 0; i < EVENT_COUNT; ++i)
+        {
+            fds[i] = openCounter(static_cast<PerfEvent>(i));
+            values[i] = 0;
+        }
+    }
+
+    ~PerfCounters()
+    {
+#ifdef __linux__
+        for (int fd: fds)
+        {
+            if (fd >= 0)
+            {
+                close(fd);
+            }
+        }
+#endif
+    }
+
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+
+    /** Resets all counters and starts counting */
+    void start()
+    {
+#ifdef __linux__
+        for (int i = 0; i < EVENT_COUNT; ++i)
+        {
+            values[i] = 0;
+            if (fds[i] >= 0)
+            {
+                ioctl(fds[i], PERF_EVENT_IOC_RESET, 0);
+                ioctl(fds[i], PERF_EVENT_IOC_ENABLE, 0);
+            }
+        }
+#endif
+    }
+
+    /** Stops counting, the counted values are available via get() */
+    void stop()
+    {
+#ifdef __linux__
+        for (int i = 0; i < EVENT_COUNT; ++i)
+        {
+            if (fds[i] < 0)
+            {
+                continue;
+            }
+            ioctl(fds[i], PERF_EVENT_IOC_DISABLE, 0);
+
+            // value, time enabled, time running - the latter two are used to scale the value
+            // in case the kernel had to multiplex the counters
+            uint64_t buf[3] = {0, 0, 0};
+            if (read(fds[i], buf, sizeof(buf)) != static_cast<ssize_t>(sizeof(buf)))
+            {
+                continue;
+            }
+            values[i] = (buf[2] == 0 || buf[2] >= buf[1])
+                        ? buf[0]
+                        : static_cast<uint64_t>(static_cast<double>(buf[0]) * buf[1] / buf[2]);
+        }
+#endif
+    }
+
+    bool isAvailable(PerfEvent event) const
+    {
+        return fds[static_cast<int>(event)] >= 0;
+    }
+
+    bool anyAvailable() const
+    {
+        for (int fd: fds)
+        {
+            if (fd >= 0)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /** Value counted between the last start()/stop() pair, 0 if the event isn't available */
+    uint64_t get(PerfEvent event) const
+    {
+        return values[static_cast<int>(event)];
+    }
+
+    /** Prints every counted event, both in total and divided by the number of VM operations
+     * @param out Stream to print to
+     * @param label Describes the measured region
+     * @param vmOpCount Number of VMread/VMwrite calls performed in the measured region
+     */
+    void report(std::ostream& out, const std::string& label, uint64_t vmOpCount) const
+    {
+        out << "[perf] " << label << " (" << vmOpCount << " VM ops)";
+        if (!anyAvailable())
+        {
+            out << ": hardware counters are unavailable" << std::endl;
+            return;
+        }
+        // the formatting below shouldn't affect whatever is printed to 'out' later
+        std::ios state(nullptr);
+        state.copyfmt(out);
+        out << std::endl;
+        for (int i = 0; i < EVENT_COUNT; ++i)
+        {
+            PerfEvent event = static_cast<PerfEvent>(i);
+            out << "[perf]     " << std::left << std::setw(14) << eventName(event) << std::right;
+            if (!isAvailable(event))
+            {
+                out << "unavailable" << std::endl;
+                continue;
+            }
+            double perOp = vmOpCount == 0 ? 0.0 : static_cast<double>(get(event)) / vmOpCount;
+            out << std::setw(14) << get(event) << " total, "
+                << std::fixed << std::setprecision(2) << perOp << " per op" << std::endl;
+        }
+        out.copyfmt(state);
+    }
+
+    static const char* eventName(PerfEvent event)
+    {
+        switch (event)
+        {
+            case PerfEvent::Cycles: return "cycles";
+            case PerfEvent::Instructions: return "instructions";
+            case PerfEvent::L1DataMisses: return "L1d-misses";
+            case PerfEvent::LLCMisses: return "LLC-misses";
+            case PerfEvent::BranchMisses: return "branch-misses";
+            case PerfEvent::PageFaults: return "page-faults";
+            default: return "?";
+        }
+    }
+
+private:
+
+    /** Opens a disabled counter for the calling thread, returns -1 if unable to */
+    static int openCounter(PerfEvent event)
+    {
+#ifdef __linux__
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+        switch (event)
+        {
+            case PerfEvent::Cycles:
+                attr.type = PERF_TYPE_HARDWARE;
+                attr.config = PERF_COUNT_HW_CPU_CYCLES;
+                break;
+            case PerfEvent::Instructions:
+                attr.type = PERF_TYPE_HARDWARE;
+                attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+                break;
+            case PerfEvent::L1DataMisses:
+                attr.type = PERF_TYPE_HW_CACHE;
+                attr.config = PERF_COUNT_HW_CACHE_L1D
+                              | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+                              | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+                break;
+            case PerfEvent::LLCMisses:
+                attr.type = PERF_TYPE_HARDWARE;
+                attr.config = PERF_COUNT_HW_CACHE_MISSES;
+                break;
+            case PerfEvent::BranchMisses:
+                attr.type = PERF_TYPE_HARDWARE;
+                attr.config = PERF_COUNT_HW_BRANCH_MISSES;
+                break;
+            case PerfEvent::PageFaults:
+                attr.type = PERF_TYPE_SOFTWARE;
+                attr.config = PERF_COUNT_SW_PAGE_FAULTS;
+                break;
+            default:
+                return -1;
+        }
+
+        long fd = syscall(SYS_perf_event_open, &attr, 0 /* this thread */, -1 /* any cpu */,
+                          -1 /* no group */, 0);
+        return fd < 0 ? -1 : static_cast<int>(fd);
+#else
+        (void)event;
+        return -1;
+#endif
+    }
+};
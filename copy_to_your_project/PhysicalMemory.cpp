@@ -2,22 +2,455 @@
 #include "MemoryConstants.h"
 
 
+#include <map>
+#include <set>
 #include <vector>
 #include <unordered_map>
 #include <cassert>
+#include <cstdint>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
 
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
 
-#ifdef INC_TESTING_CODE
-std::unique_ptr<std::stringstream> Trace::ss (new std::stringstream());
+
+namespace {
+
+const std::size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+const std::size_t ARENA_ALIGNMENT = alignof(std::max_align_t);
+
+std::size_t roundUp(std::size_t value, std::size_t multiple) {
+    return (value + multiple - 1) / multiple * multiple;
+}
+
+// NUMA node of the calling thread, -1 if unknown
+int localNumaNode() {
+#if defined(__linux__) && defined(SYS_getcpu)
+    unsigned cpu = 0;
+    unsigned node = 0;
+    if (syscall(SYS_getcpu, &cpu, &node, nullptr) == 0 && node < 63) {
+        return static_cast<int>(node);
+    }
+#endif
+    return -1;
+}
+
+/*
+ * state of RamAllocation::HugePages - frames and pages are carved out of huge page
+ * backed regions, and freed ones are kept in free lists for reuse.
+ * every region remembers which NUMA node it was meant to be bound to, and memory is
+ * only reused by allocations that want the same binding. regions are never unmapped.
+ */
+struct RamArena {
+    // node a region is meant to be bound to, when not binding to any node
+    static const int UNBOUND = -1;
+
+    struct Region {
+        char* base;
+        std::size_t size;
+        std::size_t used;
+
+        // bytes currently handed out from this region
+        std::size_t live;
+
+        int requestedNode;
+
+        // node the region is actually bound to (UNBOUND if binding failed or wasn't requested)
+        int numaNode;
+
+        const char* backing;
+    };
+
+    RamAllocation allocation = RamAllocation::Default;
+    bool bindToLocalNumaNode = false;
+
+    // node new allocations should be bound to, resolved when the allocation is selected
+    int requestedNode = UNBOUND;
+
+    // allocations that had to fall back to the heap since the allocation was selected
+    uint64_t heapFallbacks = 0;
+
+    std::vector<Region> regions;
+    std::map<std::pair<int, std::size_t>, std::vector<void*>> freeLists;
+
+    RamArena() {
+        const char* env = std::getenv("EX4_RAM_ALLOCATION");
+        if (env == nullptr) {
+            return;
+        }
+        if (std::strcmp(env, "default") == 0) {
+            select(RamAllocation::Default, false);
+        } else if (std::strcmp(env, "hugepages") == 0) {
+            select(RamAllocation::HugePages, false);
+        } else if (std::strcmp(env, "hugepages-local-node") == 0) {
+            select(RamAllocation::HugePages, true);
+        } else {
+            std::fprintf(stderr, "warning: unknown EX4_RAM_ALLOCATION \"%s\" (expected \"default\", \"hugepages\" "
+                                 "or \"hugepages-local-node\"), using the default allocation\n", env);
+        }
+    }
+
+    void select(RamAllocation allocation, bool bindToLocalNumaNode) {
+        this->allocation = allocation;
+        this->bindToLocalNumaNode = bindToLocalNumaNode;
+        requestedNode = bindToLocalNumaNode ? localNumaNode() : UNBOUND;
+        heapFallbacks = 0;
+    }
+
+    // returns false if no memory could be mapped at all
+    bool mapRegion(std::size_t size, Region& region) {
+#ifdef __linux__
+        void* mem = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        const char* backing = "hugetlbfs";
+        if (mem == MAP_FAILED) {
+            // no reserved huge pages - map normal pages aligned to a huge page,
+            // so transparent huge pages can back them
+            std::size_t mappedSize = size + HUGE_PAGE_SIZE;
+            void* raw = mmap(nullptr, mappedSize, PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (raw == MAP_FAILED) {
+                return false;
+            }
+            char* rawStart = static_cast<char*>(raw);
+            char* aligned = reinterpret_cast<char*>(
+                roundUp(reinterpret_cast<std::uintptr_t>(rawStart), HUGE_PAGE_SIZE));
+            if (aligned != rawStart) {
+                munmap(rawStart, aligned - rawStart);
+            }
+            if (aligned + size != rawStart + mappedSize) {
+                munmap(aligned + size, rawStart + mappedSize - (aligned + size));
+            }
+            mem = aligned;
+            backing = "normal pages";
+#ifdef MADV_HUGEPAGE
+            if (madvise(mem, size, MADV_HUGEPAGE) == 0) {
+                backing = "transparent huge pages";
+            }
 #endif
+        }
+
+        int numaNode = UNBOUND;
+#ifdef SYS_mbind
+        if (requestedNode != UNBOUND) {
+            const int MPOL_BIND_MODE = 2;
+            unsigned long nodeMask = 1UL << requestedNode;
+            if (syscall(SYS_mbind, mem, size, MPOL_BIND_MODE, &nodeMask,
+                        sizeof(nodeMask) * CHAR_BIT, 0) == 0) {
+                numaNode = requestedNode;
+            }
+        }
+#endif
+        region = Region{static_cast<char*>(mem), size, 0, 0, requestedNode, numaNode, backing};
+        return true;
+#else
+        (void)size;
+        (void)region;
+        return false;
+#endif
+    }
+
+    Region* findRegion(const void* ptr) {
+        const char* p = static_cast<const char*>(ptr);
+        for (Region& region: regions) {
+            if (p >= region.base && p < region.base + region.size) {
+                return &region;
+            }
+        }
+        return nullptr;
+    }
+
+    // returns nullptr if no memory could be mapped
+    void* allocate(std::size_t bytes) {
+        std::size_t size = roundUp(bytes == 0 ? 1 : bytes, ARENA_ALIGNMENT);
+        std::vector<void*>& freeList = freeLists[std::make_pair(requestedNode, size)];
+        if (!freeList.empty()) {
+            void* ptr = freeList.back();
+            freeList.pop_back();
+            findRegion(ptr)->live += size;
+            return ptr;
+        }
+
+        Region* region = nullptr;
+        for (auto it = regions.rbegin(); it != regions.rend(); ++it) {
+            if (it->requestedNode == requestedNode && it->used + size <= it->size) {
+                region = &*it;
+                break;
+            }
+        }
+        if (region == nullptr) {
+            Region mapped;
+            if (!mapRegion(roundUp(size, HUGE_PAGE_SIZE), mapped)) {
+                return nullptr;
+            }
+            regions.push_back(mapped);
+            region = &regions.back();
+        }
+        void* ptr = region->base + region->used;
+        region->used += size;
+        region->live += size;
+        return ptr;
+    }
+
+    // returns false if 'ptr' wasn't allocated from a region
+    bool deallocate(void* ptr, std::size_t bytes) {
+        Region* region = findRegion(ptr);
+        if (region == nullptr) {
+            return false;
+        }
+        std::size_t size = roundUp(bytes == 0 ? 1 : bytes, ARENA_ALIGNMENT);
+        region->live -= size;
+        freeLists[std::make_pair(region->requestedNode, size)].push_back(ptr);
+        return true;
+    }
+};
+
+const int RamArena::UNBOUND;
+
+// never destroyed, as RAM and the swap file may still be destroyed after it
+RamArena& ramArena() {
+    static RamArena* arena = new RamArena();
+    return *arena;
+}
+
+}
+
+void PMsetRamAllocation(RamAllocation allocation, bool bindToLocalNumaNode) {
+    ramArena().select(allocation, bindToLocalNumaNode);
+}
+
+void PMgetRamAllocation(RamAllocation* allocation, bool* bindToLocalNumaNode) {
+    *allocation = ramArena().allocation;
+    *bindToLocalNumaNode = ramArena().bindToLocalNumaNode;
+}
+
+std::string PMdescribeRamAllocation() {
+    const RamArena& arena = ramArena();
+    if (arena.allocation == RamAllocation::Default) {
+        return "default";
+    }
+
+    // describe the regions currently handing out memory for the selected binding
+    std::string backings;
+    std::set<int> nodes;
+    bool anyUnbound = false;
+    for (const RamArena::Region& region: arena.regions) {
+        if (region.live == 0 || region.requestedNode != arena.requestedNode) {
+            continue;
+        }
+        if (backings.find(region.backing) == std::string::npos) {
+            backings += (backings.empty() ? "" : ", ") + std::string(region.backing);
+        }
+        if (region.numaNode == RamArena::UNBOUND) {
+            anyUnbound = true;
+        } else {
+            nodes.insert(region.numaNode);
+        }
+    }
+
+    std::string description = "hugepages (" + (backings.empty() ? std::string("nothing allocated") : backings);
+    if (arena.bindToLocalNumaNode && !backings.empty()) {
+        if (nodes.empty()) {
+            description += ", NUMA binding unavailable";
+        } else {
+            description += anyUnbound ? ", partially bound to NUMA node" : ", NUMA node";
+            for (int node: nodes) {
+                description += " " + std::to_string(node);
+            }
+        }
+    }
+    if (arena.heapFallbacks > 0) {
+        description += ", " + std::to_string(arena.heapFallbacks) + " allocations fell back to the heap";
+    }
+    return description + ")";
+}
 
+void* PMallocateRam(std::size_t bytes) {
+    RamArena& arena = ramArena();
+    if (arena.allocation == RamAllocation::HugePages) {
+        void* ptr = arena.allocate(bytes);
+        if (ptr != nullptr) {
+            return ptr;
+        }
+        ++arena.heapFallbacks;
+    }
+    return ::operator new(bytes);
+}
 
-typedef std::vector<word_t> page_t;
+void PMdeallocateRam(void* ptr, std::size_t bytes) {
+    if (!ramArena().deallocate(ptr, bytes)) {
+        ::operator delete(ptr);
+    }
+}
 
 std::vector<page_t> RAM;
 std::unordered_map<uint64_t, page_t> swapFile;
 
+
+#ifdef INC_TESTING_CODE
+std::unique_ptr<std::stringstream> Trace::ss (new std::stringstream());
+bool Trace::enabled = true;
+
+PhysicalMemoryState PMfork() {
+    PhysicalMemoryState state;
+    state.ram = RAM;
+    state.swapFile = swapFile;
+    return state;
+}
+
+void PMswitch(PhysicalMemoryState& state) {
+    RAM.swap(state.ram);
+    swapFile.swap(state.swapFile);
+    AccessHeatmap::forgetFramePages();
+}
+
+
+const uint64_t AccessHeatmap::NO_PAGE;
+bool AccessHeatmap::enabled = false;
+uint64_t AccessHeatmap::windowSize = 1;
+uint64_t AccessHeatmap::samplingPeriod = 1;
+uint64_t AccessHeatmap::untilNextSample = 1;
+uint64_t AccessHeatmap::operations = 0;
+std::vector<uint64_t> AccessHeatmap::framePages;
+std::vector<AccessHeatmap::Window> AccessHeatmap::windows;
+
+static const char* const OPERATION_NAMES[AccessHeatmap::OperationCount] = {
+    "reads", "writes", "evicts", "restores"
+};
+
+void AccessHeatmap::enable(uint64_t windowSize, uint64_t samplingPeriod) {
+    assert(windowSize > 0 && samplingPeriod > 0);
+    AccessHeatmap::windowSize = windowSize;
+    AccessHeatmap::samplingPeriod = samplingPeriod;
+    // count the samplingPeriod-th operation, then every samplingPeriod-th one after it
+    untilNextSample = samplingPeriod;
+    operations = 0;
+    framePages.assign(NUM_FRAMES, NO_PAGE);
+    windows.clear();
+    enabled = true;
+}
+
+void AccessHeatmap::disable() {
+    enabled = false;
+}
+
+void AccessHeatmap::forgetFramePages() {
+    if (enabled) {
+        framePages.assign(NUM_FRAMES, NO_PAGE);
+    }
+}
+
+void AccessHeatmap::recordEnabled(Operation op, uint64_t frameIndex, uint64_t pageIndex) {
+    assert(frameIndex < NUM_FRAMES);
+
+    // the frame's page must be tracked even if this operation isn't sampled
+    if (op == Evict) {
+        framePages[frameIndex] = NO_PAGE;
+    } else if (op == Restore) {
+        framePages[frameIndex] = pageIndex;
+    } else {
+        pageIndex = framePages[frameIndex];
+    }
+
+    uint64_t windowIndex = operations++ / windowSize;
+    if (--untilNextSample != 0) {
+        return;
+    }
+    untilNextSample = samplingPeriod;
+
+    if (windows.size() <= windowIndex) {
+        Window empty;
+        empty.frames.assign(NUM_FRAMES, Counters());
+        windows.resize(windowIndex + 1, empty);
+    }
+    Window& window = windows[windowIndex];
+    ++window.frames[frameIndex].count[op];
+    if (pageIndex != NO_PAGE) {
+        ++window.pages[pageIndex].count[op];
+    }
+}
+
+static bool isZero(const AccessHeatmap::Counters& counters) {
+    for (uint64_t count: counters.count) {
+        if (count != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void AccessHeatmap::exportCSV(std::ostream& out) {
+    out << "window,window_start,sampling_period,kind,index";
+    for (const char* name: OPERATION_NAMES) {
+        out << "," << name;
+    }
+    out << std::endl;
+
+    auto writeRow = [&](uint64_t windowIndex, const char* kind, uint64_t index, const Counters& counters) {
+        out << windowIndex << "," << windowIndex * windowSize << "," << samplingPeriod
+            << "," << kind << "," << index;
+        for (uint64_t count: counters.count) {
+            out << "," << count;
+        }
+        out << "\n";
+    };
+
+    for (uint64_t w = 0; w < windows.size(); ++w) {
+        for (uint64_t frame = 0; frame < windows[w].frames.size(); ++frame) {
+            if (!isZero(windows[w].frames[frame])) {
+                writeRow(w, "frame", frame, windows[w].frames[frame]);
+            }
+        }
+        std::map<uint64_t, Counters> sortedPages(windows[w].pages.begin(), windows[w].pages.end());
+        for (const auto& kvp: sortedPages) {
+            writeRow(w, "page", kvp.first, kvp.second);
+        }
+    }
+    out.flush();
+}
+
+void AccessHeatmap::exportJSON(std::ostream& out) {
+    auto writeObject = [&](const char* kind, uint64_t index, const Counters& counters) {
+        out << "{\"" << kind << "\": " << index;
+        for (int op = 0; op < OperationCount; ++op) {
+            out << ", \"" << OPERATION_NAMES[op] << "\": " << counters.count[op];
+        }
+        out << "}";
+    };
+
+    out << "{\"windowSize\": " << windowSize
+        << ", \"samplingPeriod\": " << samplingPeriod
+        << ", \"windows\": [";
+    for (uint64_t w = 0; w < windows.size(); ++w) {
+        out << (w == 0 ? "" : ", ") << "{\"window\": " << w << ", \"frames\": [";
+        bool first = true;
+        for (uint64_t frame = 0; frame < windows[w].frames.size(); ++frame) {
+            if (!isZero(windows[w].frames[frame])) {
+                out << (first ? "" : ", ");
+                writeObject("frame", frame, windows[w].frames[frame]);
+                first = false;
+            }
+        }
+        out << "], \"pages\": [";
+        first = true;
+        std::map<uint64_t, Counters> sortedPages(windows[w].pages.begin(), windows[w].pages.end());
+        for (const auto& kvp: sortedPages) {
+            out << (first ? "" : ", ");
+            writeObject("page", kvp.first, kvp.second);
+            first = false;
+        }
+        out << "]}";
+    }
+    out << "]}" << std::endl;
+}
+#endif
+
 void initialize() {
     RAM.resize(NUM_FRAMES, page_t(PAGE_SIZE));
 }
@@ -28,17 +461,22 @@ void PMread(uint64_t physicalAddress, word_t* value) {
 
     assert(physicalAddress < RAM_SIZE);
 
-    *value = RAM[physicalAddress / PAGE_SIZE][physicalAddress
-             % PAGE_SIZE];
+    // read through a const reference, so a frame that is shared isn't copied
+    const page_t& frame = RAM[physicalAddress / PAGE_SIZE];
+    *value = frame[physicalAddress % PAGE_SIZE];
 
 #ifdef INC_TESTING_CODE
-    Trace::stream() << "PMread(" << physicalAddress << ") = " << *value << std::endl;
+    if (Trace::isEnabled())
+        Trace::stream() << "PMread(" << physicalAddress << ") = " << *value << std::endl;
+    AccessHeatmap::record(AccessHeatmap::Read, physicalAddress / PAGE_SIZE);
 #endif
  }
 
 void PMwrite(uint64_t physicalAddress, word_t value) {
 #ifdef INC_TESTING_CODE
-    Trace::stream() << "PMwrite(" << physicalAddress << ", " << value << ")" << std::endl;
+    if (Trace::isEnabled())
+        Trace::stream() << "PMwrite(" << physicalAddress << ", " << value << ")" << std::endl;
+    AccessHeatmap::record(AccessHeatmap::Write, physicalAddress / PAGE_SIZE);
 #endif
 
     if (RAM.empty())
@@ -52,7 +490,9 @@ void PMwrite(uint64_t physicalAddress, word_t value) {
 
 void PMevict(uint64_t frameIndex, uint64_t evictedPageIndex) {
 #ifdef INC_TESTING_CODE
-    Trace::stream() << "PMevict(" << frameIndex << ", " << evictedPageIndex << ")" << std::endl;
+    if (Trace::isEnabled())
+        Trace::stream() << "PMevict(" << frameIndex << ", " << evictedPageIndex << ")" << std::endl;
+    AccessHeatmap::record(AccessHeatmap::Evict, frameIndex, evictedPageIndex);
 #endif
 
     if (RAM.empty())
@@ -62,12 +502,21 @@ void PMevict(uint64_t frameIndex, uint64_t evictedPageIndex) {
     assert(frameIndex < NUM_FRAMES);
     assert(evictedPageIndex < NUM_PAGES);
 
-    swapFile[evictedPageIndex] = RAM[frameIndex];
+    // the swap file shares the frame's words, they're only copied if the frame is written to.
+    // operator[] isn't used, as it would first allocate a page of zeros only to replace it
+    auto it = swapFile.find(evictedPageIndex);
+    if (it == swapFile.end()) {
+        swapFile.emplace(evictedPageIndex, RAM[frameIndex]);
+    } else {
+        it->second = RAM[frameIndex];
+    }
 }
 
 void PMrestore(uint64_t frameIndex, uint64_t restoredPageIndex) {
 #ifdef INC_TESTING_CODE
-    Trace::stream() << "PMrestore(" << frameIndex << ", " << restoredPageIndex << ")" << std::endl;
+    if (Trace::isEnabled())
+        Trace::stream() << "PMrestore(" << frameIndex << ", " << restoredPageIndex << ")" << std::endl;
+    AccessHeatmap::record(AccessHeatmap::Restore, frameIndex, restoredPageIndex);
 #endif
 
     if (RAM.empty())
@@ -78,10 +527,11 @@ void PMrestore(uint64_t frameIndex, uint64_t restoredPageIndex) {
     // page is not in swap file, so this is essentially
     // the first reference to this page. we can just return
     // as it doesn't matter if the page contains garbage
-    if (swapFile.find(restoredPageIndex) == swapFile.end()) {
+    auto it = swapFile.find(restoredPageIndex);
+    if (it == swapFile.end()) {
         return;
     }
 
-    RAM[frameIndex] = std::move(swapFile[restoredPageIndex]);
-    swapFile.erase(restoredPageIndex);
+    RAM[frameIndex] = it->second;
+    swapFile.erase(it);
 }
@@ -1,16 +1,165 @@
 #pragma once
 
 #include "MemoryConstants.h"
+#include <cstddef>
+#include <memory>
 #include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+
+/*
+ * where the words of RAM frames and swap file pages are allocated
+ */
+enum class RamAllocation {
+    // the default heap
+    Default,
+
+    // an arena backed by huge pages (MAP_HUGETLB, or transparent huge pages if none are reserved),
+    // falling back to normal pages if neither is available
+    HugePages
+};
+
+/*
+ * selects the allocation of frames and pages that are allocated from now on,
+ * usually followed by re-initializing RAM. if 'bindToLocalNumaNode' is set, huge page
+ * arenas are bound to the NUMA node of the calling thread.
+ * the initial allocation can be chosen with the environment variable EX4_RAM_ALLOCATION
+ * ("default", "hugepages" or "hugepages-local-node").
+ */
+void PMsetRamAllocation(RamAllocation allocation, bool bindToLocalNumaNode = false);
+
+/*
+ * puts the current allocation in 'allocation' and 'bindToLocalNumaNode'
+ */
+void PMgetRamAllocation(RamAllocation* allocation, bool* bindToLocalNumaNode);
+
+/*
+ * describes the current allocation and the memory it is actually handing out, e.g
+ * "hugepages (transparent huge pages, NUMA node 0)"
+ */
+std::string PMdescribeRamAllocation();
+
+void* PMallocateRam(std::size_t bytes);
+void PMdeallocateRam(void* ptr, std::size_t bytes);
+
+/*
+ * allocator used for frames and pages, forwards to the current RamAllocation
+ */
+template <typename T>
+struct RamAllocator {
+    typedef T value_type;
+
+    RamAllocator() = default;
+
+    template <typename U>
+    RamAllocator(const RamAllocator<U>&) {}
+
+    T* allocate(std::size_t n) {
+        return static_cast<T*>(PMallocateRam(n * sizeof(T)));
+    }
+
+    void deallocate(T* ptr, std::size_t n) {
+        PMdeallocateRam(ptr, n * sizeof(T));
+    }
+};
+
+template <typename T, typename U>
+bool operator==(const RamAllocator<T>&, const RamAllocator<U>&) { return true; }
+
+template <typename T, typename U>
+bool operator!=(const RamAllocator<T>&, const RamAllocator<U>&) { return false; }
+
+
+/*
+ * contents of a frame in RAM, or of a page in the swap file.
+ *
+ * copies share the same words until one of them is written to (copy-on-write),
+ * so evicting a page or copying the entire physical memory (see PMfork) only costs
+ * time and memory for the pages that are modified afterwards.
+ */
+class CowPage {
+    typedef std::vector<word_t, RamAllocator<word_t>> words_t;
+
+    std::shared_ptr<words_t> words;
+
+    // words->data(), kept here so reads only follow a single pointer
+    word_t* wordsData;
+
+    template <typename... Args>
+    static std::shared_ptr<words_t> makeWords(Args&&... args) {
+        return std::allocate_shared<words_t>(RamAllocator<words_t>(), std::forward<Args>(args)...);
+    }
+
+    // gives this page its own copy of the words, if they're shared with another page
+    void detach() {
+        if (words.use_count() > 1) {
+            words = makeWords(*words);
+            wordsData = words->data();
+        }
+    }
+
+public:
+    typedef word_t value_type;
+    typedef words_t::size_type size_type;
+    typedef words_t::iterator iterator;
+    typedef words_t::const_iterator const_iterator;
+
+    CowPage() : CowPage(PAGE_SIZE) {}
+
+    explicit CowPage(size_type size) : words(makeWords(size)), wordsData(words->data()) {}
+
+    template <typename InputIt>
+    CowPage(InputIt first, InputIt last) : words(makeWords(first, last)), wordsData(words->data()) {}
+
+    CowPage(const CowPage&) = default;
+    CowPage& operator=(const CowPage&) = default;
+
+    // moving is copying: it only shares the words, and leaves the moved-from page
+    // with words of its own, like every other page
+    CowPage(CowPage&& other) noexcept : CowPage(static_cast<const CowPage&>(other)) {}
+    CowPage& operator=(CowPage&& other) noexcept { return *this = static_cast<const CowPage&>(other); }
+
+    size_type size() const { return words->size(); }
+
+    const word_t& operator[](size_type i) const { return wordsData[i]; }
+    word_t& operator[](size_type i) { detach(); return wordsData[i]; }
+
+    const word_t* data() const { return wordsData; }
+    word_t* data() { detach(); return wordsData; }
+
+    const_iterator begin() const { return words->cbegin(); }
+    const_iterator end() const { return words->cend(); }
+    iterator begin() { detach(); return words->begin(); }
+    iterator end() { detach(); return words->end(); }
+
+    /* whether both pages currently share the same words (no copy was made yet) */
+    bool sharesWordsWith(const CowPage& other) const {
+        return words == other.words;
+    }
+
+    friend bool operator==(const CowPage& a, const CowPage& b) {
+        return a.words == b.words || *a.words == *b.words;
+    }
+
+    friend bool operator!=(const CowPage& a, const CowPage& b) {
+        return !(a == b);
+    }
+};
+
+typedef CowPage page_t;
 
 #ifdef INC_TESTING_CODE
 
 #include <memory>
+#include <ostream>
 #include <sstream>
 
 
 class Trace {
     static std::unique_ptr<std::stringstream> ss;
+    static bool enabled;
 
 public:
 
@@ -22,12 +171,112 @@ public:
         return *ss;
     }
 
+    /* while disabled, operations aren't written to the trace (e.g, when measuring performance) */
+    inline static void setEnabled(bool enable) {
+        enabled = enable;
+    }
+
+    inline static bool isEnabled() {
+        return enabled;
+    }
+
     inline std::string GetContents() {
         return ss->str();
     }
 };
 
 
+/*
+ * counts PMread/PMwrite/PMevict/PMrestore calls per frame and per page, bucketed into
+ * windows of consecutive operations - this shows which frames are hot (e.g, page tables)
+ * and which pages thrash. disabled by default.
+ *
+ * reads and writes are attributed to the page that was last restored into their frame,
+ * so reads and writes of page tables are only counted per frame.
+ */
+class AccessHeatmap {
+public:
+    enum Operation { Read = 0, Write, Evict, Restore, OperationCount };
+
+    struct Counters {
+        uint64_t count[OperationCount];
+    };
+
+    struct Window {
+        std::vector<Counters> frames;
+        std::unordered_map<uint64_t, Counters> pages;
+    };
+
+    /*
+     * discards previous counts and starts counting. every window spans 'windowSize' operations,
+     * of which only every 'samplingPeriod'-th operation is counted, to reduce overhead.
+     */
+    static void enable(uint64_t windowSize, uint64_t samplingPeriod = 1);
+
+    static void disable();
+
+    /*
+     * forgets which page was restored into each frame, must be called whenever RAM is
+     * replaced as a whole (PMswitch already does), otherwise reads and writes would be
+     * attributed to pages of the previous state
+     */
+    static void forgetFramePages();
+
+    inline static bool isEnabled() {
+        return enabled;
+    }
+
+    inline static void record(Operation op, uint64_t frameIndex, uint64_t pageIndex = NO_PAGE) {
+        if (enabled) {
+            recordEnabled(op, frameIndex, pageIndex);
+        }
+    }
+
+    inline static const std::vector<Window>& getWindows() {
+        return windows;
+    }
+
+    /* one line per window and frame/page that had any counted operations */
+    static void exportCSV(std::ostream& out);
+
+    static void exportJSON(std::ostream& out);
+
+private:
+    static const uint64_t NO_PAGE = UINT64_MAX;
+
+    static bool enabled;
+    static uint64_t windowSize;
+    static uint64_t samplingPeriod;
+    static uint64_t untilNextSample;
+    static uint64_t operations;
+    static std::vector<uint64_t> framePages;
+    static std::vector<Window> windows;
+
+    static void recordEnabled(Operation op, uint64_t frameIndex, uint64_t pageIndex);
+};
+
+
+/*
+ * the entire state of the physical memory - RAM and the swap file
+ */
+struct PhysicalMemoryState {
+    std::vector<page_t> ram;
+    std::unordered_map<uint64_t, page_t> swapFile;
+};
+
+/*
+ * returns a copy of the current physical memory state (like fork()), all frames and
+ * swap file pages are shared with the current state until either of them modifies them
+ */
+PhysicalMemoryState PMfork();
+
+/*
+ * exchanges the current physical memory state with 'state', this is cheap, and can be
+ * used to switch back and forth between a forked state and the one it was forked from
+ */
+void PMswitch(PhysicalMemoryState& state);
+
+
 #endif
 
 /*
@@ -2,11 +2,16 @@
 #include "PhysicalMemory.h"
 #include "VirtualMemory.h"
 #include "Common.h"
+#include "Checkpoint.h"
+#include "PerfCounters.h"
 
 #include <gtest/gtest.h>
+#include <algorithm>
+#include <chrono>
 #include <cstdio>
 #include <cassert>
 #include <map>
+#include <memory>
 #include <random>
 
 
@@ -176,8 +181,46 @@ TEST(SimpleTests, Can_Read_And_Write_Memory_Once)
 // Params: test name, from, to, increment, Initialization method
 using Params = std::tuple<const char*, uint64_t, uint64_t, uint64_t, InitializationMethod>;
 
+/** Enable this to count hardware events(cycles, cache misses, page faults etc.) during the
+ *  write and read loops of the test below, they'll be printed per VM operation.
+ *
+ *  If the counters can't be opened on your system, the test still runs normally.
+ */
+const bool MEASURE_PERF_COUNTERS = false;
+
+/** Enable this to count physical memory operations per frame and per page during each of the
+ *  tests below, they'll be exported to <test name>.csv/.json in the working directory.
+ *  Counts are bucketed into windows of HEATMAP_WINDOW_SIZE operations, and only every
+ *  HEATMAP_SAMPLING_PERIOD-th operation is counted(increase it if the tests become too slow).
+ */
+const bool EXPORT_ACCESS_HEATMAP = false;
+const uint64_t HEATMAP_WINDOW_SIZE = 100000;
+const uint64_t HEATMAP_SAMPLING_PERIOD = 1;
+
 struct ReadWriteTestFixture : public ::testing::TestWithParam<Params>
-{};
+{
+    void SetUp() override
+    {
+        if (EXPORT_ACCESS_HEATMAP)
+        {
+            AccessHeatmap::enable(HEATMAP_WINDOW_SIZE, HEATMAP_SAMPLING_PERIOD);
+        }
+    }
+
+    void TearDown() override
+    {
+        if (EXPORT_ACCESS_HEATMAP)
+        {
+            AccessHeatmap::disable();
+            if (!IsSkipped())
+            {
+                std::string name = ::testing::UnitTest::GetInstance()->current_test_info()->name();
+                std::replace(name.begin(), name.end(), '/', '_');
+                exportAccessHeatmap(name);
+            }
+        }
+    }
+};
 
 
 /** The following test writes random values in a loop,
@@ -207,28 +250,59 @@ TEST_P(ReadWriteTestFixture, Deterministic_Addresses_Random_Values)
 
     std::default_random_engine eng = getRandomEngine();
     std::uniform_int_distribution<word_t> dist(0, std::numeric_limits<word_t>::max());
-    std::map<uint64_t, word_t> ixToVal;
+
+    // values are generated in advance, so that measuring performance counters
+    // counts as little as possible besides the VM operations themselves
+    std::vector<word_t> genValues;
+    for (uint64_t i = from; i < to; i += increment) {
+        genValues.push_back(dist(eng));
+    }
 
 
     setLogging(false);
     fullyInitialize(method);
 
-    for (uint64_t i = from; i < to; i += increment) {
-        word_t genValue = dist(eng);
-        ixToVal[i] = genValue;
+    // only opened when measuring, opening them costs a few syscalls
+    std::unique_ptr<PerfCounters> counters;
+    if (MEASURE_PERF_COUNTERS)
+    {
+        counters.reset(new PerfCounters());
+        counters->start();
+    }
+
+    uint64_t vmOpCount = 0;
+    for (uint64_t i = from, ix = 0; i < to; i += increment, ++ix) {
+        word_t genValue = genValues[ix];
 //        std::cout << "Writing " << genValue << " to address " << i << std::endl;
         ASSERT_EQ(VMwrite(i, genValue), 1) << "write should succeed";
 
         word_t value;
         ASSERT_EQ(VMread(i, &value), 1) << "immediate read should succeed";
         ASSERT_EQ(uint64_t(value), genValue) << "immediate read: wrong value read";
+        vmOpCount += 2;
     }
 
-    for (uint64_t i = from; i < to; i += increment) {
+    // the counted loops also include the test's own checks of every result
+    if (counters)
+    {
+        counters->stop();
+        counters->report(std::cout, std::string(testName) + " write loop, including checks", vmOpCount);
+        vmOpCount = 0;
+        counters->start();
+    }
+
+    for (uint64_t i = from, ix = 0; i < to; i += increment, ++ix) {
         word_t value;
         ASSERT_EQ(VMread(i, &value), 1) << "read should succeed";
 //        std::cout << "Read " << value << " from address " << i << std::endl;
-        ASSERT_EQ(value, ixToVal.at(i)) << "wrong value was read";
+        ASSERT_EQ(value, genValues[ix]) << "wrong value was read";
+        ++vmOpCount;
+    }
+
+    if (counters)
+    {
+        counters->stop();
+        counters->report(std::cout, std::string(testName) + " read loop, including checks", vmOpCount);
     }
 }
 
@@ -373,6 +447,482 @@ TEST(RandomTests, Random_Addresses_Random_Values)
     }
 }
 
+/** Saves a checkpoint in the middle of a random run, keeps running, then loads the checkpoint
+ *  and ensures we're back at the exact same state - both physically and virtually.
+ **/
+TEST(CheckpointTests, Loading_Checkpoint_Restores_State)
+{
+    fullyInitialize(InitializationMethod::RandomizeValues);
+    setLogging(false);
+    std::unordered_map<uint64_t, word_t> vmToValue;
+    std::default_random_engine eng = getRandomEngine();
+    std::uniform_int_distribution<uint64_t> vmAddrDist(0, VIRTUAL_MEMORY_SIZE-1);
+    std::uniform_int_distribution<word_t> valueDist(0, std::numeric_limits<word_t>::max());
+
+    for (uint64_t i = 0; i < RANDOM_TEST_ITERATIONS_COUNT / 10; ++i)
+    {
+        uint64_t virtAddr = vmAddrDist(eng);
+        word_t val = valueDist(eng);
+        ASSERT_EQ(VMwrite(virtAddr, val), 1) << "write should succeed";
+        vmToValue[virtAddr] = val;
+    }
+
+    const std::string path = ::testing::TempDir() + "ex4_checkpoint_test.bin";
+    ASSERT_TRUE(saveCheckpoint(path));
+    const std::vector<page_t> savedRAM = RAM;
+    const std::unordered_map<uint64_t, page_t> savedSwapFile = swapFile;
+    const uint64_t savedTracePosition = currentTracePosition();
+
+    // diverge from the saved state
+    for (uint64_t i = 0; i < RANDOM_TEST_ITERATIONS_COUNT / 10; ++i)
+    {
+        ASSERT_EQ(VMwrite(vmAddrDist(eng), valueDist(eng)), 1) << "write should succeed";
+    }
+
+    uint64_t loadedTracePosition = 0;
+    ASSERT_TRUE(loadCheckpoint(path, &loadedTracePosition));
+    ASSERT_EQ(RAM, savedRAM) << "RAM is different than it was when the checkpoint was saved";
+    ASSERT_EQ(swapFile, savedSwapFile) << "Swap file is different than it was when the checkpoint was saved";
+    ASSERT_EQ(loadedTracePosition, savedTracePosition) << "Trace position is different than it was when the checkpoint was saved";
+
+    for (const auto& kvp: vmToValue)
+    {
+        word_t readVal;
+        ASSERT_EQ(VMread(kvp.first, &readVal), 1) << "read should succeed";
+        ASSERT_EQ(readVal, kvp.second) << "read value is different than the value written before the checkpoint";
+    }
+
+    // swap file pages that are out of range, or appear twice, are rejected
+    const uint64_t swapOffset = checkpointFileSize(0, 0);
+    const uint64_t swapEntrySize = sizeof(uint64_t) + PAGE_SIZE * sizeof(word_t);
+    if (!swapFile.empty())
+    {
+        ASSERT_TRUE(saveCheckpoint(path));
+        {
+            std::fstream file(path, std::ios::binary | std::ios::in | std::ios::out);
+            uint64_t badIndex = NUM_PAGES;
+            file.seekp(swapOffset);
+            file.write(reinterpret_cast<const char*>(&badIndex), sizeof(badIndex));
+        }
+        ASSERT_FALSE(loadCheckpoint(path)) << "Loading a swap file page that is out of range should fail";
+    }
+    if (swapFile.size() >= 2)
+    {
+        ASSERT_TRUE(saveCheckpoint(path));
+        {
+            std::fstream file(path, std::ios::binary | std::ios::in | std::ios::out);
+            uint64_t firstIndex;
+            file.seekg(swapOffset);
+            file.read(reinterpret_cast<char*>(&firstIndex), sizeof(firstIndex));
+            file.seekp(swapOffset + swapEntrySize);
+            file.write(reinterpret_cast<const char*>(&firstIndex), sizeof(firstIndex));
+        }
+        ASSERT_FALSE(loadCheckpoint(path)) << "Loading a swap file page that appears twice should fail";
+    }
+    ASSERT_TRUE(saveCheckpoint(path));
+
+    // a checkpoint with a different version(e.g, from an older version of these tests) is rejected
+    {
+        std::fstream file(path, std::ios::binary | std::ios::in | std::ios::out);
+        uint32_t badVersion = CHECKPOINT_VERSION + 1;
+        file.seekp(offsetof(CheckpointHeader, version));
+        file.write(reinterpret_cast<const char*>(&badVersion), sizeof(badVersion));
+    }
+    std::vector<page_t> ramBeforeFailedLoad = RAM;
+    ASSERT_FALSE(loadCheckpoint(path)) << "Loading a checkpoint of a different version should fail";
+    ASSERT_EQ(RAM, ramBeforeFailedLoad) << "A failed load shouldn't change RAM";
+
+    std::remove(path.c_str());
+}
+
+/** Forks the physical memory in the middle of a random run, then keeps writing in the forked state.
+ *  The state it was forked from shouldn't be affected, and frames that weren't written to
+ *  after the fork should still be shared between both states.
+ **/
+TEST(ForkTests, Forked_State_Diverges_Independently)
+{
+    fullyInitialize(InitializationMethod::RandomizeValues);
+    setLogging(false);
+    std::unordered_map<uint64_t, word_t> parentVmToValue;
+    std::default_random_engine eng = getRandomEngine();
+    std::uniform_int_distribution<uint64_t> vmAddrDist(0, VIRTUAL_MEMORY_SIZE-1);
+    std::uniform_int_distribution<word_t> valueDist(0, std::numeric_limits<word_t>::max());
+
+    uint64_t lastAddr = 0;
+    for (uint64_t i = 0; i < RANDOM_TEST_ITERATIONS_COUNT / 10; ++i)
+    {
+        lastAddr = vmAddrDist(eng);
+        word_t val = valueDist(eng);
+        ASSERT_EQ(VMwrite(lastAddr, val), 1) << "write should succeed";
+        parentVmToValue[lastAddr] = val;
+    }
+
+    PhysicalMemoryState other = PMfork();
+    for (uint64_t frame = 0; frame < NUM_FRAMES; ++frame)
+    {
+        ASSERT_TRUE(other.ram[frame].sharesWordsWith(RAM[frame])) << "Frame " << frame << " was copied during fork";
+    }
+
+    // switch to the child, 'other' now holds the parent
+    PMswitch(other);
+
+    // the last written page is still in RAM and its tables are in place, so overwriting it
+    // should only write to(and copy) a single frame
+    ASSERT_EQ(VMwrite(lastAddr, parentVmToValue[lastAddr] + 1), 1) << "write should succeed";
+    uint64_t copiedFrames = 0;
+    for (uint64_t frame = 0; frame < NUM_FRAMES; ++frame)
+    {
+        copiedFrames += RAM[frame].sharesWordsWith(other.ram[frame]) ? 0 : 1;
+    }
+    ASSERT_EQ(copiedFrames, 1) << "Only the written frame should've been copied";
+
+    std::unordered_map<uint64_t, word_t> childVmToValue = parentVmToValue;
+    childVmToValue[lastAddr] = parentVmToValue[lastAddr] + 1;
+    for (uint64_t i = 0; i < RANDOM_TEST_ITERATIONS_COUNT / 10; ++i)
+    {
+        uint64_t virtAddr = vmAddrDist(eng);
+        word_t val = valueDist(eng);
+        ASSERT_EQ(VMwrite(virtAddr, val), 1) << "write should succeed";
+        childVmToValue[virtAddr] = val;
+    }
+
+    // back to the parent
+    PMswitch(other);
+    for (const auto& kvp: parentVmToValue)
+    {
+        word_t readVal;
+        ASSERT_EQ(VMread(kvp.first, &readVal), 1) << "read should succeed";
+        ASSERT_EQ(readVal, kvp.second) << "writes in the forked state changed the state it was forked from";
+    }
+
+    // and to the child again
+    PMswitch(other);
+    for (const auto& kvp: childVmToValue)
+    {
+        word_t readVal;
+        ASSERT_EQ(VMread(kvp.first, &readVal), 1) << "read should succeed";
+        ASSERT_EQ(readVal, kvp.second) << "read value in the forked state is different than expected";
+    }
+}
+
+/** Counts operations with the access heatmap during a random run, and ensures the
+ *  counts match the operations that appear in the trace.
+ **/
+TEST(HeatmapTests, Heatmap_Counts_Match_Trace)
+{
+    fullyInitialize(InitializationMethod::RandomizeValues);
+    setLogging(false);
+    Trace trace;
+    std::default_random_engine eng = getRandomEngine();
+    std::uniform_int_distribution<uint64_t> vmAddrDist(0, VIRTUAL_MEMORY_SIZE-1);
+    std::uniform_int_distribution<word_t> valueDist(0, std::numeric_limits<word_t>::max());
+
+    const uint64_t windowSize = 1000;
+    const size_t traceStart = trace.GetContents().size();
+    AccessHeatmap::enable(windowSize);
+    for (uint64_t i = 0; i < RANDOM_TEST_ITERATIONS_COUNT / 10; ++i)
+    {
+        ASSERT_EQ(VMwrite(vmAddrDist(eng), valueDist(eng)), 1) << "write should succeed";
+    }
+    AccessHeatmap::disable();
+
+    std::map<std::string, uint64_t> traceCounts;
+    std::stringstream traceLines(trace.GetContents().substr(traceStart));
+    std::string line;
+    uint64_t totalOperations = 0;
+    while (std::getline(traceLines, line))
+    {
+        ++traceCounts[line.substr(0, line.find('('))];
+        ++totalOperations;
+    }
+
+    uint64_t frameCounts[AccessHeatmap::OperationCount] = {0};
+    uint64_t pageCounts[AccessHeatmap::OperationCount] = {0};
+    for (const AccessHeatmap::Window& window: AccessHeatmap::getWindows())
+    {
+        for (const AccessHeatmap::Counters& counters: window.frames)
+        {
+            for (int op = 0; op < AccessHeatmap::OperationCount; ++op)
+            {
+                frameCounts[op] += counters.count[op];
+            }
+        }
+        for (const auto& kvp: window.pages)
+        {
+            for (int op = 0; op < AccessHeatmap::OperationCount; ++op)
+            {
+                pageCounts[op] += kvp.second.count[op];
+            }
+        }
+    }
+
+    ASSERT_EQ(AccessHeatmap::getWindows().size(), (totalOperations + windowSize - 1) / windowSize);
+    ASSERT_EQ(frameCounts[AccessHeatmap::Read], traceCounts["PMread"]);
+    ASSERT_EQ(frameCounts[AccessHeatmap::Write], traceCounts["PMwrite"]);
+    ASSERT_EQ(frameCounts[AccessHeatmap::Evict], traceCounts["PMevict"]);
+    ASSERT_EQ(frameCounts[AccessHeatmap::Restore], traceCounts["PMrestore"]);
+    ASSERT_EQ(pageCounts[AccessHeatmap::Evict], traceCounts["PMevict"]) << "Every evict should be counted per page";
+    ASSERT_EQ(pageCounts[AccessHeatmap::Restore], traceCounts["PMrestore"]) << "Every restore should be counted per page";
+    ASSERT_LE(pageCounts[AccessHeatmap::Write], frameCounts[AccessHeatmap::Write]);
+}
+
+/** Same as above, but only every 7th operation is counted */
+TEST(HeatmapTests, Heatmap_Sampling_Counts_Every_Nth_Operation)
+{
+    fullyInitialize(InitializationMethod::RandomizeValues);
+    setLogging(false);
+    std::default_random_engine eng = getRandomEngine();
+    std::uniform_int_distribution<uint64_t> vmAddrDist(0, VIRTUAL_MEMORY_SIZE-1);
+    std::uniform_int_distribution<word_t> valueDist(0, std::numeric_limits<word_t>::max());
+
+    const uint64_t windowSize = 1000;
+    const uint64_t samplingPeriod = 7;
+    const uint64_t traceStart = currentTracePosition();
+    AccessHeatmap::enable(windowSize, samplingPeriod);
+    for (uint64_t i = 0; i < RANDOM_TEST_ITERATIONS_COUNT / 10; ++i)
+    {
+        ASSERT_EQ(VMwrite(vmAddrDist(eng), valueDist(eng)), 1) << "write should succeed";
+    }
+    AccessHeatmap::disable();
+
+    const std::string traceOut = Trace::stream().str().substr(traceStart);
+    const uint64_t totalOperations = std::count(traceOut.begin(), traceOut.end(), '\n');
+    ASSERT_GE(totalOperations, samplingPeriod);
+
+    uint64_t counted = 0;
+    for (const AccessHeatmap::Window& window: AccessHeatmap::getWindows())
+    {
+        for (const AccessHeatmap::Counters& counters: window.frames)
+        {
+            for (uint64_t count: counters.count)
+            {
+                counted += count;
+            }
+        }
+    }
+    ASSERT_EQ(counted, totalOperations / samplingPeriod) << "Exactly every " << samplingPeriod << "th operation should be counted";
+
+    // operations are numbered from 0, so the last counted one is 'samplingPeriod' * (number counted) - 1
+    const uint64_t lastCountedOperation = samplingPeriod * counted - 1;
+    ASSERT_EQ(AccessHeatmap::getWindows().size(), lastCountedOperation / windowSize + 1);
+}
+
+/** After RAM is replaced, reads shouldn't be attributed to pages that were restored into the old RAM */
+TEST(HeatmapTests, Heatmap_Forgets_Pages_When_RAM_Is_Replaced)
+{
+    const uint64_t frame = NUM_FRAMES - 1;
+    fullyInitialize(InitializationMethod::ZeroMemory);
+    AccessHeatmap::enable(1000);
+    PMrestore(frame, 0);
+    word_t value;
+    PMread(frame * PAGE_SIZE, &value);
+    ASSERT_EQ(AccessHeatmap::getWindows().at(0).pages.at(0).count[AccessHeatmap::Read], 1);
+
+    fullyInitialize(InitializationMethod::ZeroMemory);
+    PMread(frame * PAGE_SIZE, &value);
+    AccessHeatmap::disable();
+    ASSERT_EQ(AccessHeatmap::getWindows().at(0).pages.at(0).count[AccessHeatmap::Read], 1)
+        << "A read after re-initializing RAM was attributed to a page of the previous RAM";
+}
+
+/** Exports the heatmap of a short, known sequence of operations and ensures both formats are exactly as expected */
+TEST(HeatmapTests, Heatmap_Export_Formats)
+{
+    const uint64_t frame = NUM_FRAMES - 1;
+    const std::string f = std::to_string(frame);
+    fullyInitialize(InitializationMethod::ZeroMemory);
+    swapFile.clear();
+
+    // windows of 2 operations, of which only the 2nd is counted
+    AccessHeatmap::enable(2, 2);
+    word_t value;
+    PMrestore(frame, 0);
+    PMwrite(frame * PAGE_SIZE, 5);          // window 0, counted for page 0
+    PMread(frame * PAGE_SIZE, &value);
+    PMevict(frame, 0);                      // window 1, counted for page 0
+    PMread(frame * PAGE_SIZE, &value);
+    PMwrite(frame * PAGE_SIZE, 6);          // window 2, the frame holds no page
+    AccessHeatmap::disable();
+
+    std::stringstream csv;
+    AccessHeatmap::exportCSV(csv);
+    ASSERT_EQ(csv.str(),
+              "window,window_start,sampling_period,kind,index,reads,writes,evicts,restores\n"
+              "0,0,2,frame," + f + ",0,1,0,0\n"
+              "0,0,2,page,0,0,1,0,0\n"
+              "1,2,2,frame," + f + ",0,0,1,0\n"
+              "1,2,2,page,0,0,0,1,0\n"
+              "2,4,2,frame," + f + ",0,1,0,0\n");
+
+    std::stringstream json;
+    AccessHeatmap::exportJSON(json);
+    ASSERT_EQ(json.str(),
+              "{\"windowSize\": 2, \"samplingPeriod\": 2, \"windows\": ["
+              "{\"window\": 0, "
+              "\"frames\": [{\"frame\": " + f + ", \"reads\": 0, \"writes\": 1, \"evicts\": 0, \"restores\": 0}], "
+              "\"pages\": [{\"page\": 0, \"reads\": 0, \"writes\": 1, \"evicts\": 0, \"restores\": 0}]}, "
+              "{\"window\": 1, "
+              "\"frames\": [{\"frame\": " + f + ", \"reads\": 0, \"writes\": 0, \"evicts\": 1, \"restores\": 0}], "
+              "\"pages\": [{\"page\": 0, \"reads\": 0, \"writes\": 0, \"evicts\": 1, \"restores\": 0}]}, "
+              "{\"window\": 2, "
+              "\"frames\": [{\"frame\": " + f + ", \"reads\": 0, \"writes\": 1, \"evicts\": 0, \"restores\": 0}], "
+              "\"pages\": []}"
+              "]}\n");
+    ASSERT_EQ(json.str().find(", ]"), std::string::npos) << "JSON arrays shouldn't have trailing commas";
+    ASSERT_EQ(json.str().find(", }"), std::string::npos) << "JSON objects shouldn't have trailing commas";
+}
+
+/** Enable this to run Compare_Ram_Allocations below. It is disabled by default because it is slow */
+const bool COMPARE_RAM_ALLOCATIONS = false;
+
+/** Number of timed runs of every allocation, after one untimed warm-up run of each */
+const int RAM_ALLOCATION_RUNS = 5;
+
+/** Runs the same random workload with each RAM allocation, ensures the results are correct
+ *  and prints how long each one took (and its hardware counters, if MEASURE_PERF_COUNTERS is enabled).
+ *
+ *  Runs alternate between allocations(in a different order every round), and tracing is disabled
+ *  while timing, so that mostly the VM operations themselves are measured.
+ *
+ *  To run all other tests with a different allocation, set the environment variable
+ *  EX4_RAM_ALLOCATION to "hugepages" or "hugepages-local-node".
+ **/
+TEST(AllocationTests, Compare_Ram_Allocations)
+{
+    if (!COMPARE_RAM_ALLOCATIONS)
+    {
+        GTEST_SKIP() << "Enable COMPARE_RAM_ALLOCATIONS to run this benchmark";
+    }
+
+    struct AllocationConfig
+    {
+        const char* name;
+        RamAllocation allocation;
+        bool bindToLocalNumaNode;
+    };
+    const AllocationConfig configs[] = {
+        {"default", RamAllocation::Default, false},
+        {"hugepages", RamAllocation::HugePages, false},
+        {"hugepages-local-node", RamAllocation::HugePages, true},
+    };
+    const int configCount = sizeof(configs) / sizeof(configs[0]);
+
+    // restores the allocation(e.g, the one chosen by EX4_RAM_ALLOCATION) and tracing,
+    // even if an assertion fails midway
+    struct RestoreSettings
+    {
+        RamAllocation allocation;
+        bool bindToLocalNumaNode;
+        bool traceEnabled = Trace::isEnabled();
+
+        RestoreSettings()
+        {
+            PMgetRamAllocation(&allocation, &bindToLocalNumaNode);
+        }
+
+        ~RestoreSettings()
+        {
+            PMsetRamAllocation(allocation, bindToLocalNumaNode);
+            Trace::setEnabled(traceEnabled);
+        }
+    } restoreSettings;
+
+    setLogging(false);
+
+    // the same workload is used for every run
+    std::default_random_engine eng = getRandomEngine();
+    std::uniform_int_distribution<uint64_t> vmAddrDist(0, VIRTUAL_MEMORY_SIZE-1);
+    std::uniform_int_distribution<word_t> valueDist(0, std::numeric_limits<word_t>::max());
+    std::vector<uint64_t> addresses;
+    std::vector<word_t> values;
+    std::unordered_map<uint64_t, word_t> vmToValue;
+    for (uint64_t i = 0; i < RANDOM_TEST_ITERATIONS_COUNT; ++i)
+    {
+        addresses.push_back(vmAddrDist(eng));
+        values.push_back(valueDist(eng));
+        vmToValue[addresses.back()] = values.back();
+    }
+    const uint64_t vmOpCount = addresses.size() + vmToValue.size();
+
+    double bestNsPerOp[configCount];
+    double totalNsPerOp[configCount] = {0};
+    std::string descriptions[configCount];
+    std::unique_ptr<PerfCounters> counters[configCount];
+
+    // round 0 is a warm-up round and isn't measured
+    for (int round = 0; round <= RAM_ALLOCATION_RUNS; ++round)
+    {
+        for (int j = 0; j < configCount; ++j)
+        {
+            const int c = (round + j) % configCount;
+            const AllocationConfig& config = configs[c];
+            PMsetRamAllocation(config.allocation, config.bindToLocalNumaNode);
+            swapFile.clear();
+            fullyInitialize(InitializationMethod::RandomizeValues);
+
+            std::vector<word_t> readValues(vmToValue.size());
+            std::vector<int> results;
+            results.reserve(vmOpCount);
+
+            if (MEASURE_PERF_COUNTERS && round == RAM_ALLOCATION_RUNS)
+            {
+                counters[c].reset(new PerfCounters());
+                counters[c]->start();
+            }
+            Trace::setEnabled(false);
+            auto start = std::chrono::steady_clock::now();
+
+            for (uint64_t i = 0; i < addresses.size(); ++i)
+            {
+                results.push_back(VMwrite(addresses[i], values[i]));
+            }
+            uint64_t readIx = 0;
+            for (const auto& kvp: vmToValue)
+            {
+                results.push_back(VMread(kvp.first, &readValues[readIx++]));
+            }
+
+            auto elapsed = std::chrono::steady_clock::now() - start;
+            Trace::setEnabled(true);
+            if (counters[c])
+            {
+                counters[c]->stop();
+            }
+
+            for (int result: results)
+            {
+                ASSERT_EQ(result, 1) << "VM operation should succeed with " << config.name;
+            }
+            readIx = 0;
+            for (const auto& kvp: vmToValue)
+            {
+                ASSERT_EQ(readValues[readIx++], kvp.second) << "wrong value was read with " << config.name;
+            }
+
+            if (round == 0)
+            {
+                continue;
+            }
+            double nsPerOp = static_cast<double>(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()) / vmOpCount;
+            bestNsPerOp[c] = round == 1 ? nsPerOp : std::min(bestNsPerOp[c], nsPerOp);
+            totalNsPerOp[c] += nsPerOp;
+            descriptions[c] = PMdescribeRamAllocation();
+        }
+    }
+
+    for (int c = 0; c < configCount; ++c)
+    {
+        std::cout << "[alloc] " << descriptions[c] << ": best " << bestNsPerOp[c] << " ns, mean "
+                  << totalNsPerOp[c] / RAM_ALLOCATION_RUNS << " ns per VM op over "
+                  << RAM_ALLOCATION_RUNS << " runs" << std::endl;
+        if (counters[c])
+        {
+            counters[c]->report(std::cout, std::string(configs[c].name) + ", last run", vmOpCount);
+        }
+    }
+}
+
 TEST(ErrorChecks, ErrorChecks)
 {
     ASSERT_EQ(VMwrite(VIRTUAL_MEMORY_SIZE, 1337), 0) << "Writing above virtual memory size should fail";